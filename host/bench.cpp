@@ -0,0 +1,364 @@
+/*
+ * Traversal benchmark for the tree command
+ *
+ * Generates reproducible synthetic directory trees and runs a host build of tree
+ * (see infos.h) over each of them, with and without -P, reading the shim's
+ * counters back to report entries/s, syscalls per entry, peak stack depth and
+ * output bytes:
+ *
+ *   g++ -O2 -o bench host/bench.cpp
+ *   ./bench ./tree [-d scratch] [-r runs] [-- extra tree arguments]
+ *
+ * The trees are built in a new tree-bench-XXXXXX directory under scratch (/tmp by
+ * default), and only that directory is removed again.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <ftw.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+// ------------Helper functions BEGIN--------------
+
+// the pattern -P runs use, generated names end in .h when they are meant to match it
+static const char *PATTERN = "(a-z)*.h";
+
+// state of the name generator, reset for every scenario so the trees are the same on every run
+static unsigned long long seed;
+
+/**
+ * @brief
+ *  Next pseudo random number, a plain LCG is all reproducibility needs
+ */
+static unsigned int next_random()
+{
+    seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+    return seed >> 33;
+}
+
+/**
+ * @brief
+ *  Makes a random lower case name
+ * @param buf - written here
+ * @param len - number of letters
+ * @param match - end it in .h so it matches PATTERN, otherwise in .c
+ */
+static void make_name(char *buf, int len, bool match)
+{
+    for (int i = 0; i < len; i++)
+    {
+        buf[i] = 'a' + next_random() % 26;
+    }
+    strcpy(buf + len, match ? ".h" : ".c");
+}
+
+static void make_file(const char *dir, const char *name)
+{
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        perror(path);
+        exit(1);
+    }
+    close(fd);
+}
+
+static void make_dir(const char *path)
+{
+    if (mkdir(path, 0755) != 0)
+    {
+        perror(path);
+        exit(1);
+    }
+}
+
+/**
+ * @brief
+ *  Fills a directory with files
+ * @param dir - the directory
+ * @param count - number of files
+ * @param name_len - letters in each name
+ * @param match_percent - how many of them match PATTERN
+ */
+static void make_files(const char *dir, int count, int name_len, int match_percent)
+{
+    char name[512];
+    for (int i = 0; i < count; i++)
+    {
+        make_name(name, name_len, (int)(next_random() % 100) < match_percent);
+        make_file(dir, name);
+    }
+}
+
+static int remove_entry(const char *path, const struct stat *, int, struct FTW *)
+{
+    return remove(path);
+}
+
+static double now()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+// ------------Helper functions END--------------
+
+// ------------Scenarios BEGIN--------------
+
+/**
+ * @brief
+ *  One synthetic tree: how to build it, and how many entries it has
+ */
+struct scenario
+{
+    const char *name;
+    void (*build)(const char *root);
+    long entries;
+};
+
+// one directory with many files
+static void build_wide(const char *root)
+{
+    make_files(root, 20000, 12, 25);
+}
+
+// a chain of directories just short of the default TREE_MAX_DEPTH
+static void build_deep(const char *root)
+{
+    char path[4096];
+    strcpy(path, root);
+    for (int i = 0; i < 60; i++)
+    {
+        make_files(path, 2, 8, 50);
+        strcat(path, "/d");
+        make_dir(path);
+    }
+}
+
+// every directory has the same number of subdirectories and files
+static void build_balanced_level(char *path, int level)
+{
+    make_files(path, 4, 10, 25);
+    if (level == 5)
+        return;
+    size_t len = strlen(path);
+    for (int i = 0; i < 5; i++)
+    {
+        snprintf(path + len, 4096 - len, "/dir%d", i);
+        make_dir(path);
+        build_balanced_level(path, level + 1);
+        path[len] = 0;
+    }
+}
+
+static void build_balanced(const char *root)
+{
+    char path[4096];
+    strcpy(path, root);
+    build_balanced_level(path, 0);
+}
+
+// names close to the longest a directory entry can hold
+static void build_long_names(const char *root)
+{
+    make_files(root, 2000, 240, 25);
+}
+
+// the same flat directory with few, half or most of the names matching -P
+static void build_mixed(const char *root)
+{
+    const int percents[] = {10, 50, 90};
+    char path[4096];
+    for (int percent : percents)
+    {
+        snprintf(path, sizeof(path), "%s/match%d", root, percent);
+        make_dir(path);
+        make_files(path, 5000, 12, percent);
+    }
+}
+
+static scenario scenarios[] = {
+    {"wide", build_wide, 20000},
+    {"deep", build_deep, 60 * 3},
+    {"balanced", build_balanced, 3906 * 4 + 3905},
+    {"long-names", build_long_names, 2000},
+    {"mixed", build_mixed, 3 + 3 * 5000},
+};
+
+// ------------Scenarios END--------------
+
+// ------------Runs BEGIN--------------
+
+/**
+ * @brief
+ *  What one run of tree reported through the shim
+ */
+struct result
+{
+    double seconds;
+    unsigned long syscalls;
+    unsigned long peak_depth;
+    unsigned long bytes;
+};
+
+/**
+ * @brief
+ *  Runs tree once with stdout thrown away and reads the shim counters off stderr
+ * @param tree - path of the tree binary
+ * @param argv - its arguments, argv[0] included
+ * @param out - the counters
+ * @return true - if it ran and reported
+ */
+static bool run_tree(const char *tree, char **argv, result *out)
+{
+    int fds[2];
+    if (pipe(fds) != 0)
+        return false;
+    double start = now();
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        int null = open("/dev/null", O_WRONLY);
+        dup2(null, 1);
+        dup2(fds[1], 2);
+        close(fds[0]);
+        setenv("INFOS_SHIM_STATS", "1", 1);
+        execv(tree, argv);
+        _exit(127);
+    }
+    close(fds[1]);
+    char report[4096];
+    size_t len = 0;
+    ssize_t n;
+    while ((n = read(fds[0], report + len, sizeof(report) - 1 - len)) > 0)
+    {
+        len += n;
+    }
+    report[len] = 0;
+    close(fds[0]);
+    int status;
+    waitpid(pid, &status, 0);
+    out->seconds = now() - start;
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    {
+        fprintf(stderr, "%s failed:\n%s", tree, report);
+        return false;
+    }
+
+    unsigned long open_calls, getdents, seeks, close_calls, writes;
+    const char *line = strstr(report, "shim: sys_open=");
+    if (!line || sscanf(line, "shim: sys_open=%lu sys_getdents=%lu sys_lseek=%lu sys_close=%lu sys_write=%lu bytes_written=%lu peak_open_dirs=%lu",
+                        &open_calls, &getdents, &seeks, &close_calls, &writes, &out->bytes, &out->peak_depth) != 7)
+    {
+        fprintf(stderr, "no shim counters from %s, is it a host build?\n", tree);
+        return false;
+    }
+    out->syscalls = open_calls + getdents + seeks + close_calls + writes;
+    return true;
+}
+
+// ------------Runs END--------------
+
+int main(int argc, char **argv)
+{
+    const char *parent = "/tmp";
+    int runs = 3;
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: %s <tree binary> [-d scratch] [-r runs] [-- extra tree arguments]\n", argv[0]);
+        return 1;
+    }
+    const char *tree = argv[1];
+    int extra = argc;
+    for (int i = 2; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-d") == 0 && i + 1 < argc)
+            parent = argv[++i];
+        else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc)
+            runs = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--") == 0)
+        {
+            extra = i + 1;
+            break;
+        }
+        else
+        {
+            fprintf(stderr, "unknown argument %s\n", argv[i]);
+            return 1;
+        }
+    }
+    if (runs < 1)
+        runs = 1;
+
+    // a directory of its own, so nothing the bench did not create is ever removed
+    char scratch[4096];
+    snprintf(scratch, sizeof(scratch), "%s/tree-bench-XXXXXX", parent);
+    if (!mkdtemp(scratch))
+    {
+        perror(scratch);
+        return 1;
+    }
+
+    printf("%-12s %-9s %8s %10s %12s %14s %10s %12s\n",
+           "scenario", "pattern", "entries", "best ms", "entries/s", "syscalls/entry", "peak depth", "output bytes");
+    int status = 0;
+    for (scenario &s : scenarios)
+    {
+        // a failed run stops the bench, the scratch directory is still removed
+        if (status)
+            break;
+        char root[sizeof(scratch) + 64];
+        snprintf(root, sizeof(root), "%s/%s", scratch, s.name);
+        make_dir(root);
+        seed = 1;
+        s.build(root);
+
+        for (int with_pattern = 0; with_pattern < 2; with_pattern++)
+        {
+            // tree <root> [-P pattern] [extra arguments]
+            char *args[64];
+            int n = 0;
+            args[n++] = (char *)tree;
+            args[n++] = root;
+            if (with_pattern)
+            {
+                args[n++] = (char *)"-P";
+                args[n++] = (char *)PATTERN;
+            }
+            for (int i = extra; i < argc && n < 63; i++)
+            {
+                args[n++] = argv[i];
+            }
+            args[n] = nullptr;
+
+            result best = {};
+            for (int r = 0; r < runs; r++)
+            {
+                result res;
+                if (!run_tree(tree, args, &res))
+                {
+                    status = 1;
+                    break;
+                }
+                if (r == 0 || res.seconds < best.seconds)
+                    best = res;
+            }
+            if (status)
+                break;
+            printf("%-12s %-9s %8ld %10.2f %12.0f %14.3f %10lu %12lu\n",
+                   s.name, with_pattern ? PATTERN : "-", s.entries, best.seconds * 1000,
+                   s.entries / best.seconds, (double)best.syscalls / s.entries, best.peak_depth, best.bytes);
+        }
+    }
+
+    nftw(scratch, remove_entry, 64, FTW_DEPTH | FTW_PHYS);
+    return status;
+}
@@ -0,0 +1,457 @@
+/*
+ * Host stand-in for the InfOS user library, see infos.h
+ */
+
+#define INFOS_SHIM_IMPL
+#include "infos.h"
+
+#include <cstdarg>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+struct infos_shim_stats infos_shim_stats;
+
+// ------------Helper functions BEGIN--------------
+
+// directory handles currently open, used for the peak
+static unsigned long open_dirs = 0;
+
+// layout of the records returned by getdents64
+struct linux_dirent64
+{
+    unsigned long d_ino;
+    long d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+// d_type values, <dirent.h> can't be included as it clashes with the InfOS one
+#define LINUX_DT_UNKNOWN 0
+#define LINUX_DT_DIR 4
+
+/**
+ * @brief
+ *  Bumps a counter, atomically as the program may have threads
+ * @param counter - the counter
+ * @param n - amount to add
+ * @return unsigned long - the new value
+ */
+static unsigned long count(unsigned long &counter, unsigned long n = 1)
+{
+    return __atomic_add_fetch(&counter, n, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief
+ *  Writes the whole buffer, retrying on short writes
+ * @param fd - file descriptor to write to
+ * @param buf - bytes to write
+ * @param n - number of bytes
+ * @return size_t - number of bytes written
+ */
+static size_t write_all(int fd, const char *buf, size_t n)
+{
+    size_t done = 0;
+    while (done < n)
+    {
+        count(infos_shim_stats.sys_write);
+        ssize_t w = write(fd, buf + done, n - done);
+        if (w <= 0)
+        {
+            break;
+        }
+        count(infos_shim_stats.bytes_written, w);
+        done += w;
+    }
+    return done;
+}
+
+/**
+ * @brief
+ *  Turns a Linux d_type into a DIRENT_TYPE_ value
+ * @param d_type - type from getdents64
+ * @return unsigned char - the DIRENT_TYPE_ value
+ */
+static unsigned char entry_type(unsigned char d_type)
+{
+    if (d_type == LINUX_DT_DIR)
+    {
+        return DIRENT_TYPE_DIR;
+    }
+    if (d_type == LINUX_DT_UNKNOWN)
+    {
+        return DIRENT_TYPE_UNKNOWN;
+    }
+    // symlinks are not followed, so they count as files
+    return DIRENT_TYPE_FILE;
+}
+
+/**
+ * @brief
+ *  Prints the counters to stderr if INFOS_SHIM_STATS is set
+ */
+static void report_stats()
+{
+    if (!getenv("INFOS_SHIM_STATS"))
+    {
+        return;
+    }
+    const struct infos_shim_stats &s = infos_shim_stats;
+    fprintf(stderr,
+            "shim: opendir=%lu readdir=%lu getdents=%lu closedir=%lu open=%lu write=%lu close=%lu create_thread=%lu printf=%lu strlen=%lu strcmp=%lu exit=%lu\n"
+            "shim: sys_open=%lu sys_getdents=%lu sys_lseek=%lu sys_close=%lu sys_write=%lu bytes_written=%lu peak_open_dirs=%lu\n",
+            s.opendir, s.readdir, s.getdents, s.closedir, s.open, s.write, s.close, s.create_thread, s.printf, s.strlen, s.strcmp, s.exit,
+            s.sys_open, s.sys_getdents, s.sys_lseek, s.sys_close, s.sys_write, s.bytes_written, s.peak_open_dirs);
+}
+
+// ------------Helper functions END--------------
+
+// ------------Library BEGIN--------------
+
+/**
+ * @brief
+ *  Opens a directory, fails for anything that is not a directory (symlinks included)
+ * @param path - the path to open
+ * @param flags - unused, kept for the InfOS signature
+ * @return HDIR - the handle, or a negative value on error
+ */
+HDIR infos_opendir(const char *path, int flags)
+{
+    (void)flags;
+    count(infos_shim_stats.opendir);
+    count(infos_shim_stats.sys_open);
+    int fd = open(path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    unsigned long now = count(open_dirs);
+    unsigned long peak = __atomic_load_n(&infos_shim_stats.peak_open_dirs, __ATOMIC_RELAXED);
+    while (now > peak &&
+           !__atomic_compare_exchange_n(&infos_shim_stats.peak_open_dirs, &peak, now, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    {
+    }
+    return fd;
+}
+
+/**
+ * @brief
+ *  Reads the next entry of a directory, skipping '.' and '..' like InfOS does.
+ *  InfOS hands out one entry per syscall, so only the first record of each
+ *  getdents64 is used and the offset is rewound to just after it.
+ * @param dir - handle from opendir
+ * @param de - entry written here
+ * @return int - 1 if an entry was read, 0 at the end of the directory
+ */
+int infos_readdir(HDIR dir, struct dirent *de)
+{
+    count(infos_shim_stats.readdir);
+    // big enough for one record with the longest possible name
+    alignas(8) char buf[sizeof(struct linux_dirent64) + 256 + 8];
+    for (;;)
+    {
+        count(infos_shim_stats.sys_getdents);
+        long n = syscall(SYS_getdents64, (int)dir, buf, sizeof(buf));
+        if (n <= 0)
+        {
+            return 0;
+        }
+        struct linux_dirent64 *d = (struct linux_dirent64 *)buf;
+        if (d->d_reclen < n)
+        {
+            count(infos_shim_stats.sys_lseek);
+            lseek((int)dir, d->d_off, SEEK_SET);
+        }
+        if (strcmp(d->d_name, ".") == 0 || strcmp(d->d_name, "..") == 0)
+        {
+            continue;
+        }
+        size_t len = strnlen(d->d_name, sizeof(de->name) - 1);
+        memcpy(de->name, d->d_name, len);
+        de->name[len] = 0;
+        de->size = 0;
+        de->flags = 0;
+        de->type = entry_type(d->d_type);
+        return 1;
+    }
+}
+
+/**
+ * @brief
+ *  Reads as many entries as fit into buffer with a single getdents64, skipping '.' and '..'.
+ *  The Linux records are rewritten in place into the smaller dirent_records.
+ * @param dir - handle from opendir
+ * @param buffer - filled with dirent_records, has to be 8 byte aligned
+ * @param size - size of buffer
+ * @return int - bytes filled, 0 at the end of the directory, negative on error
+ */
+int infos_getdents(HDIR dir, void *buffer, unsigned int size)
+{
+    count(infos_shim_stats.getdents);
+    char *buf = (char *)buffer;
+    for (;;)
+    {
+        count(infos_shim_stats.sys_getdents);
+        long n = syscall(SYS_getdents64, (int)dir, buf, size);
+        if (n <= 0)
+        {
+            return n < 0 ? -1 : 0;
+        }
+        long out = 0;
+        for (long in = 0; in < n;)
+        {
+            struct linux_dirent64 *d = (struct linux_dirent64 *)(buf + in);
+            in += d->d_reclen;
+            if (strcmp(d->d_name, ".") == 0 || strcmp(d->d_name, "..") == 0)
+            {
+                continue;
+            }
+            // never longer than the record it replaces, so it can't overwrite one not read yet
+            unsigned char type = entry_type(d->d_type);
+            size_t len = strlen(d->d_name);
+            struct dirent_record *r = (struct dirent_record *)(buf + out);
+            memmove(r->name, d->d_name, len + 1);
+            r->type = type;
+            r->size = (3 + len + 1 + 1) & ~1;
+            out += r->size;
+        }
+        // only '.' and '..' in this read, go on to the next
+        if (out)
+        {
+            return out;
+        }
+    }
+}
+
+/**
+ * @brief
+ *  Closes a handle from opendir
+ * @param dir - the handle
+ */
+void infos_closedir(HDIR dir)
+{
+    count(infos_shim_stats.closedir);
+    if (is_error(dir))
+    {
+        return;
+    }
+    count(infos_shim_stats.sys_close);
+    close((int)dir);
+    __atomic_sub_fetch(&open_dirs, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief
+ *  Opens the console or a file for writing
+ * @param path - "/dev/console" or the path of the file
+ * @param flags - OPEN_FLAG_CREATE to create or truncate the file
+ * @return HFILE - the handle, or a negative value on error
+ */
+HFILE infos_open(const char *path, int flags)
+{
+    count(infos_shim_stats.open);
+    count(infos_shim_stats.sys_open);
+    if (strcmp(path, "/dev/console") == 0)
+    {
+        return dup(1);
+    }
+    int mode = O_WRONLY | O_CLOEXEC;
+    if (flags & OPEN_FLAG_CREATE)
+    {
+        mode |= O_CREAT | O_TRUNC;
+    }
+    int fd = ::open(path, mode, 0644);
+    return fd < 0 ? -1 : fd;
+}
+
+/**
+ * @brief
+ *  Writes a buffer to a handle from open
+ * @param file - the handle
+ * @param buffer - bytes to write
+ * @param size - number of bytes
+ * @return int - number of bytes written
+ */
+int infos_write(HFILE file, const char *buffer, unsigned int size)
+{
+    count(infos_shim_stats.write);
+    return write_all((int)file, buffer, size);
+}
+
+/**
+ * @brief
+ *  Closes a handle from open
+ * @param file - the handle
+ */
+void infos_close(HFILE file)
+{
+    count(infos_shim_stats.close);
+    if (is_error(file))
+    {
+        return;
+    }
+    count(infos_shim_stats.sys_close);
+    ::close((int)file);
+}
+
+// threads started by the program, a handle is an index into this
+struct thread
+{
+    pthread_t id;
+    ThreadProc proc;
+    void *arg;
+};
+static struct thread threads[64];
+static unsigned long thread_count = 0;
+
+static void *thread_start(void *arg)
+{
+    struct thread *t = (struct thread *)arg;
+    t->proc(t->arg);
+    return nullptr;
+}
+
+/**
+ * @brief
+ *  Starts a thread running proc(arg)
+ * @param proc - function the thread runs
+ * @param arg - passed to proc
+ * @return HTHREAD - the handle, or a negative value on error
+ */
+HTHREAD infos_create_thread(ThreadProc proc, void *arg)
+{
+    count(infos_shim_stats.create_thread);
+    unsigned long i = count(thread_count) - 1;
+    if (i >= sizeof(threads) / sizeof(threads[0]))
+    {
+        return -1;
+    }
+    threads[i].proc = proc;
+    threads[i].arg = arg;
+    if (pthread_create(&threads[i].id, nullptr, thread_start, &threads[i]) != 0)
+    {
+        return -1;
+    }
+    return i;
+}
+
+/**
+ * @brief
+ *  Waits for a thread to finish
+ * @param thread - handle from create_thread
+ */
+void infos_join_thread(HTHREAD thread)
+{
+    if (is_error(thread))
+    {
+        return;
+    }
+    pthread_join(threads[thread].id, nullptr);
+}
+
+/**
+ * @brief
+ *  Gives up the processor to another thread
+ */
+void infos_yield()
+{
+    sched_yield();
+}
+
+/**
+ * @brief
+ *  Reads the monotonic clock
+ * @return unsigned long - nanoseconds since an arbitrary start
+ */
+unsigned long infos_get_ticks()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * TICKS_PER_SECOND + t.tv_nsec;
+}
+
+/**
+ * @brief
+ *  Formats and writes straight to the console, one write per call like InfOS
+ * @param format - printf style format
+ * @return int - number of bytes written
+ */
+int infos_printf(const char *format, ...)
+{
+    static char buf[65536];
+    count(infos_shim_stats.printf);
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(buf, sizeof(buf), format, args);
+    va_end(args);
+    if (n < 0)
+    {
+        return n;
+    }
+    if (n >= (int)sizeof(buf))
+    {
+        n = sizeof(buf) - 1;
+    }
+    write_all(1, buf, n);
+    return n;
+}
+
+int infos_strlen(const char *str)
+{
+    count(infos_shim_stats.strlen);
+    return strlen(str);
+}
+
+int infos_strcmp(const char *l, const char *r)
+{
+    count(infos_shim_stats.strcmp);
+    return strcmp(l, r);
+}
+
+void infos_exit(int code)
+{
+    count(infos_shim_stats.exit);
+    report_stats();
+    _exit(code);
+}
+
+// ------------Library END--------------
+
+/**
+ * @brief
+ *  Host entry point, joins the arguments back into an InfOS command line
+ */
+int main(int argc, char **argv)
+{
+    static char cmdline[65536];
+    size_t len = 0;
+    for (int i = 1; i < argc; i++)
+    {
+        size_t n = strlen(argv[i]);
+        if (len + n + 2 > sizeof(cmdline))
+        {
+            fprintf(stderr, "command line too long\n");
+            return 1;
+        }
+        if (i > 1)
+        {
+            cmdline[len++] = ' ';
+        }
+        memcpy(cmdline + len, argv[i], n);
+        len += n;
+    }
+    cmdline[len] = 0;
+
+    int code = infos_main(cmdline);
+    report_stats();
+    return code;
+}
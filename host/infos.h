@@ -0,0 +1,150 @@
+/*
+ * Host stand-in for <infos.h>
+ *
+ * Implements the subset of the InfOS user library that tree.cpp uses on top of
+ * plain Linux syscalls, so the tree command can be built, timed and profiled
+ * outside of InfOS:
+ *
+ *   g++ -O2 -g -pthread -I host -o tree tree.cpp host/infos.cpp
+ *
+ * Every library call (and every syscall issued underneath it) is counted.  Set
+ * INFOS_SHIM_STATS in the environment to have the counters printed to stderr
+ * when the program finishes.
+ */
+
+#ifndef INFOS_HOST_SHIM_H
+#define INFOS_HOST_SHIM_H
+
+// ------------Types BEGIN--------------
+
+typedef long HANDLE;
+typedef HANDLE HDIR;
+typedef HANDLE HFILE;
+typedef HANDLE HTHREAD;
+typedef void (*ThreadProc)(void *arg);
+
+// flags for open, without OPEN_FLAG_CREATE the file has to exist already
+#define OPEN_FLAG_CREATE 1
+
+// values of dirent::type, unknown means the caller has to find out itself
+#define DIRENT_TYPE_UNKNOWN 0
+#define DIRENT_TYPE_FILE 1
+#define DIRENT_TYPE_DIR 2
+
+/**
+ * @brief
+ *  A single directory entry, filled in by readdir
+ */
+struct dirent
+{
+    char name[256];
+    unsigned int size;
+    unsigned int flags;
+    unsigned int type;
+};
+
+/**
+ * @brief
+ *  One entry in the buffer filled by getdents, the next one starts size bytes further on
+ */
+struct dirent_record
+{
+    unsigned short size;
+    unsigned char type;
+    char name[];
+};
+
+/**
+ * @brief
+ *  Call and syscall counters kept by the shim
+ */
+struct infos_shim_stats
+{
+    // library calls made by the program
+    unsigned long opendir;
+    unsigned long readdir;
+    unsigned long getdents;
+    unsigned long closedir;
+    unsigned long open;
+    unsigned long write;
+    unsigned long close;
+    unsigned long create_thread;
+    unsigned long printf;
+    unsigned long strlen;
+    unsigned long strcmp;
+    unsigned long exit;
+    // syscalls issued by the shim to service them
+    unsigned long sys_open;
+    unsigned long sys_getdents;
+    unsigned long sys_lseek;
+    unsigned long sys_close;
+    unsigned long sys_write;
+    // bytes written to the console or files
+    unsigned long bytes_written;
+    // most directory handles open at the same time
+    unsigned long peak_open_dirs;
+};
+
+extern struct infos_shim_stats infos_shim_stats;
+
+// ------------Types END--------------
+
+// ------------Library BEGIN--------------
+
+// the names are remapped so they never collide with the host libc
+#ifndef INFOS_SHIM_IMPL
+#define opendir infos_opendir
+#define readdir infos_readdir
+#define getdents infos_getdents
+#define closedir infos_closedir
+#define open infos_open
+#define write infos_write
+#define close infos_close
+#define create_thread infos_create_thread
+#define join_thread infos_join_thread
+#define yield infos_yield
+#define get_ticks infos_get_ticks
+#define printf infos_printf
+#define strlen infos_strlen
+#define strcmp infos_strcmp
+#define exit infos_exit
+#define main infos_main
+#endif
+
+#define is_error(h) ((HANDLE)(h) < 0)
+
+extern HDIR infos_opendir(const char *path, int flags);
+extern int infos_readdir(HDIR dir, struct dirent *de);
+extern void infos_closedir(HDIR dir);
+
+// bulk read of a directory into buffer as dirent_records, returns the bytes filled, 0 at the end, negative on error
+#define HAVE_GETDENTS 1
+extern int infos_getdents(HDIR dir, void *buffer, unsigned int size);
+
+// "/dev/console" opens the console, anything else a file for writing
+extern HFILE infos_open(const char *path, int flags);
+extern int infos_write(HFILE file, const char *buffer, unsigned int size);
+extern void infos_close(HFILE file);
+
+// threads run on pthreads, the counters are updated atomically so they stay exact
+extern HTHREAD infos_create_thread(ThreadProc proc, void *arg);
+extern void infos_join_thread(HTHREAD thread);
+extern void infos_yield();
+
+// monotonic clock, in ticks of 1/TICKS_PER_SECOND since an arbitrary start
+#define TICKS_PER_SECOND 1000000000UL
+extern unsigned long infos_get_ticks();
+
+extern int infos_printf(const char *format, ...) __attribute__((format(__printf__, 1, 2)));
+
+extern int infos_strlen(const char *str);
+extern int infos_strcmp(const char *l, const char *r);
+
+extern void infos_exit(int code) __attribute__((noreturn));
+
+// the program's InfOS style entry point, called with everything after argv[0]
+extern int infos_main(const char *cmdline);
+
+// ------------Library END--------------
+
+#endif
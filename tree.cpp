@@ -4,80 +4,230 @@
 
 #include <infos.h>
 
-// ------------Helper functions BEGIN--------------
+// most levels of directories that are descended into, deeper ones are listed but not opened
+#ifndef TREE_MAX_DEPTH
+#define TREE_MAX_DEPTH 64
+#endif
+// longest path that is built, longer ones can't be opened
+#ifndef TREE_MAX_PATH
+#define TREE_MAX_PATH 4096
+#endif
+// size of the output buffer, it is written out each time it fills up
+#ifndef TREE_OUTPUT_BUFFER
+#define TREE_OUTPUT_BUFFER 65536
+#endif
+// size of the buffer each open directory is read into, with getdents one read fills it with many entries
+#ifndef TREE_BATCH_BYTES
+#define TREE_BATCH_BYTES 2048
+#endif
+// most worker threads of the parallel traversal
+#ifndef TREE_MAX_WORKERS
+#define TREE_MAX_WORKERS 8
+#endif
+// directories the parallel traversal can hold at once, and bytes of entries each can hold
+#ifndef TREE_MAX_SLOTS
+#define TREE_MAX_SLOTS 256
+#endif
+#ifndef TREE_SLOT_BYTES
+#define TREE_SLOT_BYTES 8192
+#endif
+
+// ------------Statistics BEGIN--------------
+
+/**
+ * @brief
+ *  Counters for --stats. They are always kept, an increment is negligible next to the syscalls they count,
+ *  and atomically since the pool's threads update them too.
+ */
+struct statistics
+{
+    unsigned long opendir_calls;
+    unsigned long getdents_calls;
+    unsigned long readdir_calls;
+    unsigned long closedir_calls;
+    // names run through the -P and -I automata, and entries each of them left out
+    unsigned long matches;
+    unsigned long unmatched;
+    unsigned long ignored;
+    unsigned long bytes_written;
+    // most levels on the traversal stack, counted from 1 for the root as -L does
+    unsigned long max_depth;
+    // most bytes used of the static buffers
+    unsigned long peak_path;
+    unsigned long peak_prefix;
+    unsigned long peak_output;
+    unsigned long peak_slots;
+};
+
+static struct statistics stats;
+
+/**
+ * @brief
+ *  Adds to a counter
+ * @param counter - the counter
+ * @param n - amount to add
+ */
+void count(unsigned long &counter, unsigned long n = 1)
+{
+    __atomic_fetch_add(&counter, n, __ATOMIC_RELAXED);
+}
 
 /**
  * @brief
- *  Checks if the path is a directory
- * @param path the path to check
- * @return true if it is a directory
- * @return false if it is not a directory
+ *  Raises a peak to a new value if it is higher
+ * @param peak - the peak
+ * @param value - the new value
  */
-bool is_directory(char *path)
+void raise(unsigned long &peak, unsigned long value)
 {
-    HDIR dir = opendir(path, 0);
-    if (is_error(dir))
+    unsigned long old = __atomic_load_n(&peak, __ATOMIC_RELAXED);
+    while (value > old && !__atomic_compare_exchange_n(&peak, &old, value, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
     {
-        return false;
     }
+}
+
+// ------------Statistics END--------------
+
+// ------------Helper functions BEGIN--------------
+
+/**
+ * @brief
+ *  opendir, counted for --stats
+ * @param path the path to open
+ * @return HDIR the open directory, or an error handle
+ */
+HDIR open_dir(const char *path)
+{
+    count(stats.opendir_calls);
+    return opendir(path, 0);
+}
+
+/**
+ * @brief
+ *  closedir, counted for --stats
+ * @param dir the open directory
+ */
+void close_dir(HDIR dir)
+{
+    count(stats.closedir_calls);
     closedir(dir);
-    return true;
 }
+
+// what is known about an entry before opening it
+#define ENTRY_FILE 0
+#define ENTRY_UNKNOWN 1
+#define ENTRY_DIRECTORY 2
+
+#ifdef DIRENT_TYPE_FILE
 /**
  * @brief
- *  Copies a string from source upto n characters, snipped from strings.cpp
- * @param dest  - buffer to which we write
- * @param src  - source from which we copy
- * @param n  - number upto which we copy
+ *  Turns a type reported by the directory read into what is known about the entry
+ * @param type the DIRENT_TYPE_ value
+ * @return int ENTRY_FILE, ENTRY_DIRECTORY or ENTRY_UNKNOWN
  */
-void strncpy(char *dest, const char *src, int n)
+int type_kind(unsigned int type)
 {
-    while (--n && *src)
-    {
-        *dest++ = *src++;
-    }
+    if (type == DIRENT_TYPE_FILE)
+        return ENTRY_FILE;
+    if (type == DIRENT_TYPE_DIR)
+        return ENTRY_DIRECTORY;
+    return ENTRY_UNKNOWN;
+}
+#endif
 
-    // HMMM
-    *dest = 0;
+/**
+ * @brief
+ *  Tells what an entry is from the type readdir filled in, if InfOS provides one
+ * @param de the directory entry
+ * @return int ENTRY_FILE, ENTRY_DIRECTORY, or ENTRY_UNKNOWN if it has to be opened to find out
+ */
+int entry_kind(const struct dirent &de)
+{
+#ifdef DIRENT_TYPE_FILE
+    return type_kind(de.type);
+#else
+    (void)de;
+    return ENTRY_UNKNOWN;
+#endif
 }
 /**
  * @brief
- *  Does similar to copying except it does 2 strings, hence concatenating them.
+ *  Appends a string to a buffer whose length is already known, so only the appended characters are walked
  * @param dest - buffer to which we write
- * @param str1  - source from which we copy
- * @param str2  - source from which we concatenate with first source
- * @param n  - concatenate upto to n places
+ * @param len - length of the string already in dest
+ * @param src - source which is appended
+ * @param n - size of dest
+ * @return int - the new length, or -1 if src did not fit
  */
-void strcat(char *dest, const char *str1, const char *str2, int n)
+int append(char *dest, int len, const char *src, int n)
 {
-    while (--n && *str1)
+    while (*src)
     {
-        *dest++ = *str1++;
+        if (len + 1 >= n)
+        {
+            return -1;
+        }
+        dest[len++] = *src++;
     }
-    while (--n && *str2)
+    dest[len] = 0;
+    return len;
+}
+
+/**
+ * @brief
+ *  Splits the next whitespace separated argument off the command line, in place
+ * @param cursor - where to start looking, moved past the argument
+ * @return char* - the argument, or null if there are none left
+ */
+char *next_argument(char **cursor)
+{
+    char *str = *cursor;
+    while (*str == ' ')
+    {
+        str++;
+    }
+    if (!*str)
+    {
+        return nullptr;
+    }
+    char *arg = str;
+    while (*str && *str != ' ')
+    {
+        str++;
+    }
+    if (*str)
     {
-        *dest++ = *str2++;
+        *str++ = 0;
     }
-    // HMMM
-    *dest = 0;
+    *cursor = str;
+    return arg;
 }
 
 /**
  * @brief
- *  Pointer arithematic helper class
- * @param str - static string whose address is incremented
- * @param n - incremented n times
- * @return const char* - resulting address moved
+ *  Reads a decimal number out of an argument
+ * @param str - the argument
+ * @param n - where the number is written
+ * @return true - if the argument was a number
+ * @return false - if it was not
  */
-const char *increase_pointer(const char *str, int n)
+bool to_number(const char *str, int *n)
 {
-
-    for (int i = 0; i < n; i++)
+    int value = 0;
+    if (!*str)
     {
-        /* code */
-        *str++;
+        return false;
     }
-    return str;
+    while (*str)
+    {
+        if (*str < '0' || *str > '9' || value > 100000000)
+        {
+            return false;
+        }
+        value = value * 10 + (*str++ - '0');
+    }
+    *n = value;
+    return true;
 }
 
 // ------------Helper functions END--------------
@@ -87,177 +237,851 @@ const char *increase_pointer(const char *str, int n)
 /**
  * @brief
  * Regex class used for pattern matching.
+ * The pattern is compiled once into a table driven automaton so that each name is matched in a single pass,
+ * without copying it or parsing the pattern again. All the tables live inside the object, so a static regex needs no malloc.
+ *
+ * Syntax: a plain character matches itself, (abc) matches the sequence abc, (a-z) matches one character in the range,
+ * and any of these followed by * repeats it zero or more times, followed by ? makes it optional. a|b matches either side.
+ * The whole name has to match.
  */
 class regex
 {
 private:
-    // class member used to store the operation
-    char op;
+    // most characters a pattern can expand to, one bit of a state set each plus one for accepting
+    static const int MAX_POSITIONS = 63;
+    static const int ACCEPT = MAX_POSITIONS;
+    // most states of the deterministic automaton, past this we simulate the nondeterministic one instead
+    static const int MAX_STATES = 256;
+
+    // NFA: for each character the positions that accept it
+    unsigned long long accepts[256];
+    // NFA: position moved to after a position matched, and the position an optional group can skip to (0 if it can't)
+    unsigned char next[MAX_POSITIONS];
+    unsigned char skip[MAX_POSITIONS];
+    int positions = 0;
+    unsigned long long start_set = 0;
+
+    // DFA: state 0 is the dead state, 1 is the start state
+    unsigned char delta[MAX_STATES][256];
+    bool accepting[MAX_STATES];
+    bool use_nfa = false;
 
     /**
      * @brief
-     *  Finds a local pattern i.e. looks for a next pattern to recursively look for matching eg: a*b*, pat_index = 0, returns a*
-     *                                                                                                 pat_index = 2, returns b*
-     * @param buffer : written to this destination
-     * @param pattern : the whole pattern array
-     * @param pat_index : stores the index of the end of previous pattern.
+     *  Adds the positions reachable without consuming a character, skips only go forward so one pass is enough
+     * @param set - set of positions
+     * @return unsigned long long - the closed set
      */
-    void find_local_pattern(char *buffer, const char *pattern, int *pat_index, int n)
+    unsigned long long closure(unsigned long long set) const
     {
-        // some variables we need
-        int i = 0;
-        // this makes it easier to index and work with than raw addresses.
-        char str1[n + 2];
-        strncpy(str1, pattern, strlen(pattern) + 1);
-        // parse whats inside the brackets
-        if (str1[*pat_index] == '(')
+        for (int p = 0; p < positions; p++)
+        {
+            if ((set >> p & 1) && skip[p])
+            {
+                set |= 1ULL << skip[p];
+            }
+        }
+        return set;
+    }
+
+    /**
+     * @brief
+     *  Moves every position in the set over one character
+     * @param set - set of positions before the character
+     * @param c - the character
+     * @return unsigned long long - set of positions after the character
+     */
+    unsigned long long step(unsigned long long set, unsigned char c) const
+    {
+        unsigned long long matched = set & accepts[c];
+        unsigned long long result = 0;
+        while (matched)
+        {
+            int p = __builtin_ctzll(matched);
+            matched &= matched - 1;
+            result |= 1ULL << next[p];
+        }
+        return closure(result);
+    }
+
+    /**
+     * @brief
+     *  Appends one position to the automaton
+     * @param from - first character the position accepts
+     * @param to - last character the position accepts
+     */
+    void add_position(char from, char to)
+    {
+        for (int c = (unsigned char)from; c <= (unsigned char)to; c++)
+        {
+            accepts[c] |= 1ULL << positions;
+        }
+        next[positions] = positions + 1;
+        skip[positions] = 0;
+        positions += 1;
+    }
+
+    /**
+     * @brief
+     *  Finishes one alternative of the pattern, whatever moved past its end now accepts instead
+     * @param first - first position of the alternative
+     * @param starts - set of the positions the alternatives start at
+     */
+    void end_alternative(int first, unsigned long long *starts)
+    {
+        if (first == positions)
         {
-            *pat_index += 1;
+            *starts |= 1ULL << ACCEPT;
+            return;
+        }
+        *starts |= 1ULL << first;
+        for (int p = first; p < positions; p++)
+        {
+            if (next[p] == positions)
+                next[p] = ACCEPT;
+            if (skip[p] == positions)
+                skip[p] = ACCEPT;
+        }
+    }
 
-            // parse range if it is a range
-            if (str1[*pat_index + 1] == '-')
+    /**
+     * @brief
+     *  Builds the DFA out of the NFA by subset construction
+     */
+    void build_dfa()
+    {
+        unsigned long long sets[MAX_STATES];
+        int states = 2;
+        sets[0] = 0;
+        sets[1] = start_set;
+        for (int s = 0; s < states; s++)
+        {
+            accepting[s] = sets[s] >> ACCEPT & 1;
+            delta[s][0] = 0;
+            for (int c = 1; c < 256; c++)
             {
-                char a = str1[*pat_index];
-                char b = str1[*pat_index + 2];
-                int n = b - a;
-                // make sure its a valid range
-                if (n < 0)
+                unsigned long long t = step(sets[s], c);
+                int found = 0;
+                while (found < states && sets[found] != t)
                 {
-                    printf("Invalid range");
-                    exit(-1);
+                    found++;
                 }
-                // add the characters to the buffer
-                for (char j = a; j <= (int)b; j++)
+                if (found == states)
                 {
-                    buffer[i] = j;
-                    i += 1;
+                    // too many states, the NFA is matched directly instead
+                    if (states == MAX_STATES)
+                    {
+                        use_nfa = true;
+                        return;
+                    }
+                    sets[states++] = t;
                 }
-                *pat_index += 3;
+                delta[s][c] = found;
             }
-            // else parse what's inside
+        }
+    }
+
+public:
+    /**
+     * @brief
+     *  Parses the pattern and builds the tables, done once before the traversal
+     * @param pattern - the whole pattern
+     * @return true - if the pattern was valid
+     * @return false - if it was not, the reason is printed
+     */
+    bool compile(const char *pattern)
+    {
+        for (int c = 0; c < 256; c++)
+        {
+            accepts[c] = 0;
+        }
+        positions = 0;
+        use_nfa = false;
+
+        int i = 0;
+        // the positions [alternative, positions) are the alternative being parsed
+        int alternative = 0;
+        unsigned long long starts = 0;
+        while (pattern[i])
+        {
+            if (pattern[i] == '|')
+            {
+                end_alternative(alternative, &starts);
+                alternative = positions;
+                i += 1;
+                continue;
+            }
+            // the positions [first, positions) are one group that * and ? apply to
+            int first = positions;
+            // parse whats inside the brackets
+            if (pattern[i] == '(')
+            {
+                i += 1;
+                // parse range if it is a range
+                if (pattern[i] && pattern[i + 1] == '-' && pattern[i + 2] && pattern[i + 3] == ')')
+                {
+                    if (pattern[i + 2] < pattern[i])
+                    {
+                        printf("Invalid range\n");
+                        return false;
+                    }
+                    if (positions == MAX_POSITIONS)
+                    {
+                        printf("Pattern too long\n");
+                        return false;
+                    }
+                    add_position(pattern[i], pattern[i + 2]);
+                    i += 3;
+                }
+                // else every character inside is matched in sequence
+                else
+                {
+                    while (pattern[i] && pattern[i] != ')')
+                    {
+                        if (positions == MAX_POSITIONS)
+                        {
+                            printf("Pattern too long\n");
+                            return false;
+                        }
+                        add_position(pattern[i], pattern[i]);
+                        i += 1;
+                    }
+                }
+                if (pattern[i] != ')')
+                {
+                    printf("Missing ) in pattern\n");
+                    return false;
+                }
+                i += 1;
+            }
+            // if not brackets then parse the character
             else
             {
-                // parse and store in buffer until we encounter closing bracket, potential out of bounds if there isn't a )
+                if (positions == MAX_POSITIONS)
+                {
+                    printf("Pattern too long\n");
+                    return false;
+                }
+                add_position(pattern[i], pattern[i]);
+                i += 1;
+            }
 
-                while (str1[*pat_index] != ')')
+            // Operations are *,?, otherwise no operation
+            if (positions > first && (pattern[i] == '*' || pattern[i] == '?'))
+            {
+                skip[first] = positions;
+                if (pattern[i] == '*')
                 {
-                    buffer[i] = str1[*pat_index];
-                    i += 1;
-                    *pat_index += 1;
+                    next[positions - 1] = first;
                 }
-                buffer[i] = 0;
             }
-            *pat_index += 1;
+            if (pattern[i] == '*' || pattern[i] == '?')
+            {
+                i += 1;
+            }
         }
 
-        // if not brackets then parse the character
-        else
-        {
-            strncpy(buffer, &str1[*pat_index], 2);
-            *pat_index += 1;
-        }
+        end_alternative(alternative, &starts);
+        start_set = closure(starts);
+        build_dfa();
+        return true;
+    }
 
-        // Operations are *,?, otherwise N to indicate No operation
-        if (str1[*pat_index] == '*')
+    /**
+     * @brief
+     *  Checks if the string matches the compiled pattern, in one pass over the string
+     * @param str - the string that is pattern matched
+     * @return true - if the string matches the regular expression
+     * @return false - if the string doesnt match the regular expression
+     */
+    bool match(const char *str) const
+    {
+        count(stats.matches);
+        return accepts_string(str);
+    }
+
+private:
+    /**
+     * @brief
+     *  Runs the automaton over the string
+     * @param str - the string
+     * @return true - if it ends in an accepting state
+     */
+    bool accepts_string(const char *str) const
+    {
+        if (use_nfa)
         {
-            op = '*';
-            *pat_index += 1;
+            unsigned long long set = start_set;
+            while (*str && set)
+            {
+                set = step(set, *str++);
+            }
+            return set >> ACCEPT & 1;
         }
-        else if (str1[*pat_index] == '?')
+        int state = 1;
+        while (*str && state)
         {
-            op = '?';
-            *pat_index += 1;
+            state = delta[state][(unsigned char)*str++];
         }
+        return accepting[state];
+    }
+};
+/**
+ * @brief
+ * Output class, the tree is collected in a static buffer and written out in large blocks
+ * instead of one console write per piece of every line. Writes to the console or to a file.
+ */
+class writer
+{
+private:
+    HFILE out = -1;
+    char buffer[TREE_OUTPUT_BUFFER];
+    int used = 0;
+
+public:
+    /**
+     * @brief
+     *  Opens where the output goes
+     * @param path - file to write to, or null for the console
+     * @return true - if it could be opened
+     * @return false - if not, the reason is printed
+     */
+    bool open_output(const char *path)
+    {
+        if (path)
+            out = open(path, OPEN_FLAG_CREATE);
         else
+            out = open("/dev/console", 0);
+        if (is_error(out))
         {
-            op = 'N';
+            printf("Unable to open '%s' for writing.\n", path ? path : "/dev/console");
+            return false;
         }
+        return true;
+    }
+
+    /**
+     * @brief
+     *  Appends a string to the buffer, writing the buffer out whenever it fills up
+     * @param str - the string to append
+     */
+    void put(const char *str)
+    {
+        while (*str)
+        {
+            if (used == TREE_OUTPUT_BUFFER)
+                flush();
+            buffer[used++] = *str++;
+        }
+    }
+
+    /**
+     * @brief
+     *  Appends a number in decimal
+     * @param n - the number, not negative
+     */
+    void put_number(int n)
+    {
+        char digits[12];
+        int i = sizeof(digits) - 1;
+        digits[i] = 0;
+        do
+        {
+            digits[--i] = '0' + n % 10;
+            n /= 10;
+        } while (n);
+        put(&digits[i]);
+    }
+
+    /**
+     * @brief
+     *  Writes out whatever is in the buffer
+     */
+    void flush()
+    {
+        raise(stats.peak_output, used);
+        if (used)
+            write(out, buffer, used);
+        count(stats.bytes_written, used);
+        used = 0;
+    }
+
+    /**
+     * @brief
+     *  Flushes and closes the output
+     */
+    void close_output()
+    {
+        flush();
+        close(out);
     }
+};
+/**
+ * @brief
+ * Reads the entries of one open directory in batches with getdents, so a directory of N entries takes N / batch reads
+ * instead of N. Where there is no getdents, or it fails, it reads one entry at a time with readdir into the same buffer.
+ * Names are handed out straight from the buffer without copying.
+ */
+class batch
+{
+private:
+    alignas(8) char buffer[TREE_BATCH_BYTES];
+    // next record and end of the records in the buffer, len is -1 once we fell back to readdir
+    int pos = 0;
+    int len = 0;
+
+    static_assert(TREE_BATCH_BYTES >= sizeof(struct dirent), "the buffer has to hold a dirent for readdir");
 
 public:
     /**
      * @brief
-     *  Main regex function that checks if the string matches the pattern
-     * @param pattern - the whole pattern to look out for in the string
-     * @param str - the string that is pattern matched
-     * @param loca_pattern - the local pattern that is used to see if it recusively matches
-     * @param str_index - stores how far we have looked into the string
-     * @param pat_index - stores how far we have looked into the pattern
-     * @return true - if the string matches the regular expression
-     * @return false - if the string doesnt match the regular expression
+     *  Starts on a new directory
      */
-    bool match(const char *pattern, const char *str, char *loca_pattern, int str_index, int pat_index)
+    void reset()
     {
-        // copying to make indexing easier
-        char str1[strlen(str) + 2];
-        strncpy(str1, str, strlen(str) + 1);
-        // if there is no local pattern, lets find one in pattern
-        if (strlen(loca_pattern) == 0)
+        pos = 0;
+        len = 0;
+    }
+
+    /**
+     * @brief
+     *  Checks if the next entry needs a read, and so how many bytes of names it may bring in
+     * @return int - bytes the next read can hand out, 0 if the next entry is already in the buffer
+     */
+    int refill_size() const
+    {
+        if (len < 0)
+            return sizeof(struct dirent);
+        return pos == len ? TREE_BATCH_BYTES : 0;
+    }
+
+    /**
+     * @brief
+     *  Gets the next entry of the directory
+     * @param dir - the open directory
+     * @param kind - what is known about the entry, written here
+     * @return const char* - its name, valid until the next call, or null at the end
+     */
+    const char *next(HDIR dir, int *kind)
+    {
+#ifdef HAVE_GETDENTS
+        if (len >= 0 && pos == len)
         {
-            char local_pattern[strlen(pattern) + 5];
+            count(stats.getdents_calls);
+            int n = getdents(dir, buffer, TREE_BATCH_BYTES);
+            if (n == 0)
+                return nullptr;
+            pos = 0;
+            len = n < 0 ? -1 : n;
+        }
+        if (len >= 0)
+        {
+            struct dirent_record *record = (struct dirent_record *)(buffer + pos);
+            pos += record->size;
+            *kind = type_kind(record->type);
+            return record->name;
+        }
+#else
+        len = -1;
+#endif
+        struct dirent *de = (struct dirent *)buffer;
+        count(stats.readdir_calls);
+        if (!readdir(dir, de))
+            return nullptr;
+        *kind = entry_kind(*de);
+        return de->name;
+    }
+};
+
+/**
+ * @brief
+ * What the traversal shows, shared by the tree and the pool so both make the same decisions
+ */
+struct options
+{
+    // -P, files have to match it to be shown, directories are always shown
+    const regex *pattern = nullptr;
+    // -I, entries matching it are left out, directories matching it are never opened
+    const regex *ignore = nullptr;
+    // -L, number of levels shown, 0 for no limit
+    int level = 0;
 
-            find_local_pattern(local_pattern, pattern, &pat_index, strlen(pattern) + 5);
+    /**
+     * @brief
+     *  Checks if the subdirectories of a directory are opened
+     * @param depth depth of the directory, the root is 0
+     * @return true if they are opened and listed
+     * @return false if they are only shown
+     */
+    bool descends(int depth) const { return depth + 1 < TREE_MAX_DEPTH && (!level || depth + 1 < level); }
 
-            return match(pattern, str, local_pattern, str_index, pat_index);
+    /**
+     * @brief
+     *  Checks if an entry is left out before it is even opened
+     * @param name the name of the entry
+     * @param kind what is known about it, ENTRY_FILE, ENTRY_UNKNOWN or ENTRY_DIRECTORY
+     * @return true if it is not shown
+     */
+    bool skips(const char *name, int kind) const
+    {
+        if (ignore && ignore->match(name))
+        {
+            count(stats.ignored);
+            return true;
         }
-        // else parse the local pattern with the string
-        else
+        if (kind == ENTRY_FILE && pattern && !pattern->match(name))
         {
+            count(stats.unmatched);
+            return true;
+        }
+        return false;
+    }
+};
 
-            // are we at the end of the string, have we matched to the entire string?
-            if (strlen(str1) == str_index)
-            {
+/**
+ * @brief
+ *  Lock that spins until it is free, the critical sections it guards are a handful of instructions
+ */
+class spinlock
+{
+private:
+    int locked = 0;
 
-                return true;
-            }
+public:
+    void lock()
+    {
+        while (__atomic_exchange_n(&locked, 1, __ATOMIC_ACQUIRE))
+        {
+#if defined(__x86_64__) || defined(__i386__)
+            __builtin_ia32_pause();
+#endif
+        }
+    }
+    void unlock() { __atomic_store_n(&locked, 0, __ATOMIC_RELEASE); }
+};
+
+/**
+ * @brief
+ * Pool of worker threads that read directories ahead of the traversal, so reads of sibling directories overlap.
+ * Each directory to read is a job with its own slot out of a fixed static table. A worker lists the whole directory into
+ * the slot and queues a new job for every subdirectory, the traversal then prints the slots in depth first order.
+ * Each worker has its own queue and steals from the others when it runs dry. When the table is full the traversal
+ * simply reads the directory itself, so the printed tree is always the same as without the pool.
+ */
+class pool
+{
+public:
+    // states of a slot
+    static const int FREE = 0;
+    static const int QUEUED = 1;
+    static const int READING = 2;
+    static const int DONE = 3;
+    static const int FAILED = 4;
+
+    /**
+     * @brief
+     *  A directory read by the pool. bytes holds the path followed by one record per entry:
+     *  a byte with the entry_kind, two bytes with the slot of its job (or -1) and the name.
+     *  If the directory did not fit, dir is left open at the first entry not in the slot.
+     */
+    struct slot
+    {
+        int status;
+        int depth;
+        HDIR dir;
+        int entries;
+        int used;
+        char bytes[TREE_SLOT_BYTES];
+    };
+
+private:
+    static_assert(TREE_SLOT_BYTES > TREE_MAX_PATH + TREE_BATCH_BYTES, "a slot has to hold a path and a batch of entries");
+    static_assert(TREE_MAX_SLOTS <= 32768, "slots are recorded in two bytes");
+
+    // a queue of jobs, the owner takes the oldest so directories are read in the order they are printed,
+    // thieves take the newest as that is the one needed last
+    struct queue
+    {
+        spinlock lock;
+        unsigned int head;
+        unsigned int tail;
+        int jobs[TREE_MAX_SLOTS];
+    };
+
+    slot slots[TREE_MAX_SLOTS];
+    // the main thread has the last queue
+    queue queues[TREE_MAX_WORKERS + 1];
+    int threads = 0;
+    HTHREAD handles[TREE_MAX_WORKERS];
+    // workers take their index from this as they start
+    int started = 0;
+    bool finished = false;
+
+    spinlock free_lock;
+    int free_slots[TREE_MAX_SLOTS];
+    int free_count = 0;
+
+    const options *opts = nullptr;
+    // each thread builds the paths of the entries it reads here, and reads the entries into its batch
+    char paths[TREE_MAX_WORKERS + 1][TREE_MAX_PATH];
+    batch batches[TREE_MAX_WORKERS + 1];
+
+    /**
+     * @brief
+     *  Takes a free slot for a new job and copies its path in
+     * @param path - path of the directory
+     * @param depth - depth of the directory, the root is 0
+     * @return int - the slot, or -1 if there is none left
+     */
+    int allocate(const char *path, int depth)
+    {
+        free_lock.lock();
+        int s = free_count ? free_slots[--free_count] : -1;
+        raise(stats.peak_slots, TREE_MAX_SLOTS - free_count);
+        free_lock.unlock();
+        if (s < 0)
+            return -1;
+        slots[s].depth = depth;
+        slots[s].dir = -1;
+        slots[s].used = append(slots[s].bytes, 0, path, TREE_SLOT_BYTES) + 1;
+        slots[s].entries = slots[s].used;
+        return s;
+    }
+
+    /**
+     * @brief
+     *  Adds a job to the back of a queue
+     * @param q - the queue
+     * @param s - slot of the job
+     * @return true - if it was added
+     * @return false - if the queue was full
+     */
+    bool push(queue &q, int s)
+    {
+        q.lock.lock();
+        bool room = q.tail - q.head < TREE_MAX_SLOTS;
+        if (room)
+            q.jobs[q.tail++ % TREE_MAX_SLOTS] = s;
+        q.lock.unlock();
+        return room;
+    }
 
-            bool matches_pattern = true;
-            // checks if each character in the pattern matches the strindex
-            for (int i = 0; i < strlen(loca_pattern); i++)
+    /**
+     * @brief
+     *  Takes a job off a queue
+     * @param q - the queue
+     * @param oldest - take from the front, otherwise from the back
+     * @return int - slot of the job, -1 if the queue was empty
+     */
+    int pop(queue &q, bool oldest)
+    {
+        q.lock.lock();
+        int s = -1;
+        if (q.head != q.tail)
+            s = oldest ? q.jobs[q.head++ % TREE_MAX_SLOTS] : q.jobs[--q.tail % TREE_MAX_SLOTS];
+        q.lock.unlock();
+        return s;
+    }
+
+    /**
+     * @brief
+     *  Reads a directory into its slot and queues its subdirectories, called by whichever thread claimed the job
+     * @param s - slot of the job
+     * @param self - queue of the calling thread
+     */
+    void list_directory(int s, int self)
+    {
+        slot &job = slots[s];
+        HDIR dir = open_dir(job.bytes);
+        if (is_error(dir))
+        {
+            __atomic_store_n(&job.status, FAILED, __ATOMIC_RELEASE);
+            return;
+        }
+        char *path = paths[self];
+        int path_len = append(path, 0, job.bytes, TREE_MAX_PATH);
+        batch &entries = batches[self];
+        entries.reset();
+        for (;;)
+        {
+            // stop before a read that might not fit, so no entry is lost and the traversal reads the rest from the open handle.
+            // a record in the slot is never bigger than it was in the batch
+            if (job.used + entries.refill_size() > TREE_SLOT_BYTES)
             {
-                matches_pattern = matches_pattern && str1[str_index + i] == loca_pattern[i];
+                job.dir = dir;
+                break;
             }
-
-            // if the pattern is matches, lets keep
-            if (matches_pattern)
+            int kind;
+            const char *name = entries.next(dir, &kind);
+            if (!name)
             {
-                int aa = strlen(loca_pattern);
-                str_index = str_index + aa;
-                // if * keep matching
-                if (op == '*')
+                close_dir(dir);
+                break;
+            }
+            if (opts->skips(name, kind))
+                continue;
+            int child = -1;
+            if (kind != ENTRY_FILE && opts->descends(job.depth))
+            {
+                int len = append(path, path_len, "/", TREE_MAX_PATH);
+                if (len >= 0)
+                    len = append(path, len, name, TREE_MAX_PATH);
+                // too long to be opened, the traversal finds out by itself
+                if (len >= 0)
+                    child = allocate(path, job.depth + 1);
+                if (child >= 0)
                 {
-                    return match(pattern, str, loca_pattern, str_index, pat_index);
+                    __atomic_store_n(&slots[child].status, QUEUED, __ATOMIC_RELEASE);
+                    // a stale queue entry for a reused slot can let another thread claim the job before the push fails,
+                    // the slot is only given back if it is still unclaimed
+                    int expected = QUEUED;
+                    if (!push(queues[self], child) &&
+                        __atomic_compare_exchange_n(&slots[child].status, &expected, FREE, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                    {
+                        release(child);
+                        child = -1;
+                    }
                 }
-                // if ? or normal
-                else
-                {
-
-                    // find the next pattern making sure we havent run outta patterns
-                    if (pat_index == strlen(pattern) && strlen(str1) != str_index)
-                        return false;
+            }
+            char *record = job.bytes + job.used;
+            record[0] = kind;
+            record[1] = child & 0xff;
+            record[2] = (child >> 8) & 0xff;
+            job.used = append(job.bytes, job.used + 3, name, TREE_SLOT_BYTES) + 1;
+        }
+        __atomic_store_n(&job.status, DONE, __ATOMIC_RELEASE);
+    }
 
-                    char local_pattern[strlen(pattern) + 5];
+    /**
+     * @brief
+     *  Claims a queued job and reads it
+     * @param s - slot of the job
+     * @param self - queue of the calling thread
+     * @return true - if this thread got the job
+     * @return false - if another thread claimed it first
+     */
+    bool run(int s, int self)
+    {
+        int expected = QUEUED;
+        if (!__atomic_compare_exchange_n(&slots[s].status, &expected, READING, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            return false;
+        list_directory(s, self);
+        return true;
+    }
 
-                    find_local_pattern(local_pattern, pattern, &pat_index, strlen(pattern) + 5);
-                    return match(pattern, str, local_pattern, str_index, pat_index);
-                }
-            }
-            // pattern doesnt match? either change the pattern or end it
-            else
+    /**
+     * @brief
+     *  Body of a worker thread, takes jobs off its own queue or steals them until the traversal is finished
+     * @param arg - the pool
+     */
+    static void worker(void *arg)
+    {
+        pool *p = (pool *)arg;
+        // the thread's index is the first free one, handed out in order of start
+        int self = __atomic_fetch_add(&p->started, 1, __ATOMIC_RELAXED);
+        while (!__atomic_load_n(&p->finished, __ATOMIC_ACQUIRE))
+        {
+            int s = p->pop(p->queues[self], true);
+            for (int i = 1; s < 0 && i <= p->threads; i++)
             {
-                // end the pattern if we ran out
-                if (pat_index == strlen(pattern))
-                    return false;
-                // change the pattern
-                char local_pattern[strlen(pattern) + 5];
-
-                find_local_pattern(local_pattern, pattern, &pat_index, strlen(pattern) + 5);
-                return match(pattern, str, local_pattern, str_index, pat_index);
+                s = p->pop(p->queues[(self + i) % (p->threads + 1)], false);
             }
-            return false;
+            // nothing to do, give the processor to the threads that have
+            if (s < 0 || !p->run(s, self))
+                yield();
         }
     }
+
+public:
+    /**
+     * @brief
+     *  Starts the worker threads
+     * @param n - number of workers, at most TREE_MAX_WORKERS
+     * @param o - what the traversal shows
+     */
+    void start(int n, const options *o)
+    {
+        opts = o;
+        for (int s = 0; s < TREE_MAX_SLOTS; s++)
+        {
+            free_slots[s] = TREE_MAX_SLOTS - 1 - s;
+        }
+        free_count = TREE_MAX_SLOTS;
+        threads = n;
+        for (int i = 0; i < threads; i++)
+        {
+            handles[i] = create_thread(worker, this);
+        }
+    }
+
+    /**
+     * @brief
+     *  Tells the workers to finish and waits for them
+     */
+    void stop()
+    {
+        __atomic_store_n(&finished, true, __ATOMIC_RELEASE);
+        for (int i = 0; i < threads; i++)
+        {
+            join_thread(handles[i]);
+        }
+    }
+
+    /**
+     * @brief
+     *  Reads the root of the traversal on the calling thread
+     * @param path - the root
+     * @return int - slot of the root, -1 if the table is full
+     */
+    int read_root(const char *path)
+    {
+        int s = allocate(path, 0);
+        if (s < 0)
+            return -1;
+        __atomic_store_n(&slots[s].status, READING, __ATOMIC_RELAXED);
+        list_directory(s, threads);
+        return s;
+    }
+
+    /**
+     * @brief
+     *  Waits until a job has been read, reading it on the calling thread if no worker has started on it
+     * @param s - slot of the job
+     * @return int - DONE, or FAILED if the directory could not be opened
+     */
+    int wait(int s)
+    {
+        run(s, threads);
+        int status;
+        while ((status = __atomic_load_n(&slots[s].status, __ATOMIC_ACQUIRE)) == READING)
+        {
+            yield();
+        }
+        return status;
+    }
+
+    /**
+     * @brief
+     *  Gets a slot that has already been waited for
+     * @param s - the slot
+     * @return slot& - the slot
+     */
+    slot &at(int s) { return slots[s]; }
+
+    /**
+     * @brief
+     *  Gives a slot back once the traversal is done with it
+     * @param s - the slot
+     */
+    void release(int s)
+    {
+        __atomic_store_n(&slots[s].status, FREE, __ATOMIC_RELAXED);
+        free_lock.lock();
+        free_slots[free_count++] = s;
+        free_lock.unlock();
+    }
 };
+
 /**
  * @brief
  * Tree class which is used for the actual traversal of the directories.
@@ -266,77 +1090,235 @@ class tree
 {
 private:
     // variables are for tree class, hardcoded character array to make it neater
-    char *indent = "|   ";
-    char *file = "|--- ";
+    const char *indent = "|   ";
+    const char *file = "|--- ";
     // for summary at the end
     int files = 0;
     int directories = 0;
-    bool is_pattern = false;
+    // directories that were not descended because they were deeper than TREE_MAX_DEPTH
+    int truncated = 0;
+    // what is shown
+    const options *opts = nullptr;
+    // where the tree is printed
+    writer *out = nullptr;
+    // threads reading directories ahead, null to read everything here
+    pool *readers = nullptr;
+
+    // one open directory of the traversal, path_len and prefix_len are where its path and prefix end in the shared buffers.
+    // With a pool the entries come from the slot first, from cursor on, then from dir if the slot could not hold them all
+    struct frame
+    {
+        HDIR dir;
+        int slot;
+        int cursor;
+        int path_len;
+        int prefix_len;
+    };
+    // the traversal stack replaces recursion, so memory use is fixed whatever the shape of the tree
+    frame stack[TREE_MAX_DEPTH];
+    // the entries of each open directory on the stack
+    batch batches[TREE_MAX_DEPTH];
+    // path of the entry being looked at, the directories on the stack are prefixes of it.
+    // appended to on the way down and cut back on the way up, never rebuilt
+    char path[TREE_MAX_PATH];
+    // one indent per level of the stack, handled the same way
+    char prefix[TREE_MAX_DEPTH * 4 + 1];
+
+    /**
+     * @brief
+     *  Fills in a frame of the traversal stack
+     * @param depth the level of the frame
+     * @param dir the open directory, not used if there is a slot
+     * @param slot slot the pool read the directory into, or -1
+     * @param path_len end of the directory's path in the path buffer
+     * @param prefix_len end of the prefix of its entries in the prefix buffer
+     */
+    void push(int depth, HDIR dir, int slot, int path_len, int prefix_len)
+    {
+        frame &f = stack[depth];
+        f.dir = slot >= 0 ? readers->at(slot).dir : dir;
+        f.slot = slot;
+        f.cursor = slot >= 0 ? readers->at(slot).entries : 0;
+        f.path_len = path_len;
+        f.prefix_len = prefix_len;
+        batches[depth].reset();
+        raise(stats.max_depth, depth + 1);
+        raise(stats.peak_path, path_len);
+        raise(stats.peak_prefix, prefix_len);
+    }
 
 public:
     /**
-     * @brief Set the is_pattern vaiable
+     * @brief Set what the traversal shows
      *
-     * @param s boolean used to set
+     * @param o the -P, -I and -L options
      */
-    void set_is_pattern(bool s) { is_pattern = s; }
+    void set_options(const options *o) { opts = o; }
+    /**
+     * @brief Set where the tree is printed
+     *
+     * @param w opened output
+     */
+    void set_output(writer *w) { out = w; }
+    /**
+     * @brief Set the pool reading directories ahead of the traversal
+     *
+     * @param p started pool, or null to read sequentially
+     */
+    void set_pool(pool *p) { readers = p; }
     /**
      * @brief
      * Traverse the directories and print them out in tree manner with or without the optional parameter,
-     * @param path the path to traverse
-     * @param prefix the prefix indentation usually how inside it is in the file
-     * @param pattern if there is a pattern, then pattern match it to check
+     * @param root the path to traverse
      * @return int return 0 or 1, 0 if it was successfull otherwise 1
      */
-    int traverse(const char *path, char *prefix, const char *pattern)
+    int traverse(const char *root)
     {
+        int n = append(path, 0, root, TREE_MAX_PATH);
         // just in case check if the directory is valid
-        HDIR dir = opendir(path, 0);
-        if (is_error(dir))
+        HDIR dir = -1;
+        int root_slot = -1;
+        if (n >= 0 && readers)
         {
-            printf("Unable to open directory '%s' for reading.\n", path);
-            return 1;
+            root_slot = readers->read_root(root);
+            if (root_slot >= 0 && readers->wait(root_slot) == pool::FAILED)
+            {
+                readers->release(root_slot);
+                printf("Unable to open directory '%s' for reading.\n", root);
+                return 1;
+            }
         }
-        // loop through the files in this directory
-        struct dirent de;
-        while (readdir(dir, &de))
+        if (root_slot < 0)
         {
-            // if the optional -P argument is included make sure it matches the pattern
-            if (is_pattern)
+            dir = open_dir(root);
+            if (is_error(dir))
             {
-                regex r;
+                printf("Unable to open directory '%s' for reading.\n", root);
+                return 1;
+            }
+        }
+        if (n < 0)
+        {
+            printf("Path '%s' is too long.\n", root);
+            close_dir(dir);
+            return 1;
+        }
+        prefix[0] = 0;
 
-                if (!r.match(pattern, de.name, "", 0, 0))
-                    continue;
+        int depth = 0;
+        push(0, dir, root_slot, n, 0);
+        // loop through the files of the directory on top of the stack
+        while (depth >= 0)
+        {
+            frame &top = stack[depth];
+            const char *name;
+            int kind;
+            int child_slot = -1;
+            // entries already read by the pool
+            if (top.slot >= 0 && top.cursor < readers->at(top.slot).used)
+            {
+                const char *record = readers->at(top.slot).bytes + top.cursor;
+                kind = record[0];
+                child_slot = (short)((unsigned char)record[1] | (unsigned char)record[2] << 8);
+                name = record + 3;
+                top.cursor += 3 + strlen(name) + 1;
             }
-            // construct a valid path to check if it a valid directory
-            int n = strlen(de.name) + strlen(path) + 3;
-            char buffer[n + 2];
-            strcat(buffer, path, "/", n);
-            strcat(buffer, buffer, de.name, n);
-            // printing of the tree
-            printf(prefix);
-            printf(file);
-            printf("%s", de.name);
-            printf("\n");
-            // check if the buffer path is a directory and then recursively parse it
-            if (is_directory(buffer))
+            // done with this directory, go back up to its parent
+            else if (is_error(top.dir) || !(name = batches[depth].next(top.dir, &kind)))
+            {
+                if (!is_error(top.dir))
+                    close_dir(top.dir);
+                if (top.slot >= 0)
+                    readers->release(top.slot);
+                depth -= 1;
+                if (depth >= 0)
+                    prefix[stack[depth].prefix_len] = 0;
+                continue;
+            }
+            // ignored entries and files not matching -P are left out before anything is opened
+            else if (opts->skips(name, kind))
+                continue;
+            // construct a valid path to check if it a valid directory by appending the name to the directory's path,
+            // too long to fit means it can't be opened
+            int len = append(path, top.path_len, "/", TREE_MAX_PATH);
+            if (len >= 0)
+                len = append(path, len, name, TREE_MAX_PATH);
+            raise(stats.peak_path, len < 0 ? TREE_MAX_PATH : len);
+            // find out if it is a directory, it is only opened if it is listed or if there is no other way to tell
+            HDIR child = -1;
+            bool is_dir;
+            // an entry readdir says is a directory stays one even if it can't be opened, so -L doesn't change what is shown
+            if (child_slot >= 0)
+            {
+                // already read by the pool, otherwise it is a directory if the pool could open it
+                bool read = readers->wait(child_slot) != pool::FAILED;
+                is_dir = read || kind == ENTRY_DIRECTORY;
+                if (!read)
+                {
+                    readers->release(child_slot);
+                    child_slot = -1;
+                }
+            }
+            else if (kind == ENTRY_FILE)
+                is_dir = false;
+            else if (kind == ENTRY_DIRECTORY)
             {
-                directories += 1;
-                int n = strlen(prefix) + strlen(indent) + 3;
-                char new_prefix[n + 2];
-                strcat(new_prefix, prefix, indent, n);
-                traverse(buffer, new_prefix, pattern);
+                is_dir = true;
+                if (len >= 0 && opts->descends(depth))
+                    child = open_dir(path);
             }
-            // else we know its a file
             else
+            {
+                if (len >= 0)
+                    child = open_dir(path);
+                is_dir = !is_error(child);
+            }
+
+            // -P only applies to files, the ones known to be files were matched by skips() already
+            if (!is_dir && kind != ENTRY_FILE && opts->pattern && !opts->pattern->match(name))
+            {
+                count(stats.unmatched);
+                continue;
+            }
+            // printing of the tree
+            out->put(prefix);
+            out->put(file);
+            out->put(name);
+            out->put("\n");
+            if (!is_dir)
+            {
                 files += 1;
+                continue;
+            }
+            directories += 1;
+            // too deep to go inside, list it but don't open it
+            if (!opts->descends(depth))
+            {
+                if (!is_error(child))
+                    close_dir(child);
+                // cut off by TREE_MAX_DEPTH rather than -L
+                if (!opts->level || depth + 1 < opts->level)
+                    truncated += 1;
+                continue;
+            }
+            // listed but unreadable, nothing to go inside
+            if (is_error(child) && child_slot < 0)
+                continue;
+            // push it so it is parsed next, with the same handle or the pool's slot
+            int prefix_len = append(prefix, top.prefix_len, indent, sizeof(prefix));
+            depth += 1;
+            push(depth, child, child_slot, len, prefix_len);
         }
-        closedir(dir);
-        // this makes sure that, it is the intial directory without indentation
-        if (prefix == "")
+        out->put_number(directories);
+        out->put(" directories, ");
+        out->put_number(files);
+        out->put(" files \n");
+        if (truncated)
         {
-            printf("%d directories, %d files \n", directories, files);
+            out->put_number(truncated);
+            out->put(" directories not opened, deeper than ");
+            out->put_number(TREE_MAX_DEPTH);
+            out->put(" levels\n");
         }
         return 0;
     }
@@ -348,92 +1330,144 @@ public:
 int main(const char *cmdline)
 {
 
-    tree T;
+    // static since it holds the traversal stack and path buffers
+    static tree T;
+    // compiled once here and shared by every match, static since they hold the automaton tables
+    static regex matcher;
+    static regex ignorer;
+    static options opts;
+    // static since it holds the output buffer
+    static writer out;
+    // static since it holds the slots of the parallel traversal
+    static pool readers;
+    // the arguments are split in place in a copy of the command line
+    static char args[TREE_MAX_PATH];
 
-    const char *path, *pattern;
-    bool is_pattern = false;
     // taken from ls
-    if (!cmdline || strlen(cmdline) == 0)
+    const char *path = "/usr";
+    const char *pattern = nullptr;
+    const char *ignore = nullptr;
+    const char *output = nullptr;
+    int threads = 0;
+    bool show_stats = false;
+    bool has_path = false;
+
+    // tree [directory] [-P pattern] [-I pattern] [-L level] [-o file] [-j threads] [--stats], in any order
+    if (cmdline && append(args, 0, cmdline, sizeof(args)) < 0)
     {
-        path = "/usr";
+        printf("Command line too long\n");
+        return 1;
     }
-    else
+    char *cursor = args;
+    char *arg;
+    while ((arg = next_argument(&cursor)))
     {
-        // store the index of the only 2 possible whitespaces eg: tree [directory]  -P   [pattern]
-        //                                                                     s1-^ s2-^
-        int s1, s2;
-        s1 = 0;
-        s2 = 0;
-        // for loop that stores the index of the whitespace.
-        for (int i = 0; i < strlen(cmdline); i++)
+        if (strcmp(arg, "-P") == 0)
         {
-            if (cmdline[i] == ' ')
+            pattern = next_argument(&cursor);
+            if (!pattern)
             {
-
-                if (not s1)
-                {
-                    s1 = i;
-                }
-                else
-                {
-                    s2 = i;
-                }
+                printf("No pattern given with -P argument\n");
+                return 1;
             }
         }
-        // make sure there is a whitespace
-        if (s1 != 0)
+        else if (strcmp(arg, "-I") == 0)
         {
-            // two strings one for path or -P
-            char str1[s1 + 1], str2[s2 - s1 + 1];
-            strncpy(str1, cmdline, s1 + 1);
-            // increment the pointer
-            cmdline = increase_pointer(cmdline, s1);
-            // if it is of the form tree -P <pattern>
-            if (strcmp(str1, "-P") == 0)
+            ignore = next_argument(&cursor);
+            if (!ignore)
             {
-
-                path = "/usr";
-                // safety statement
-                if (!cmdline)
-                {
-                    printf("No pattern given with -P argument");
-                    return 1;
-                }
-                is_pattern = true;
-                T.set_is_pattern(is_pattern);
-                return T.traverse(path, "", cmdline);
+                printf("No pattern given with -I argument\n");
+                return 1;
             }
-            // else its tree <directory> -P <pattern>
-            else
+        }
+        else if (strcmp(arg, "-L") == 0)
+        {
+            const char *level = next_argument(&cursor);
+            if (!level || !to_number(level, &opts.level) || opts.level == 0)
             {
-
-                // remove whitespace
-                cmdline = increase_pointer(cmdline, 1);
-                strncpy(str2, cmdline, 3);
-                if (strcmp(str2, "-P") == 0)
-                {
-                    cmdline = increase_pointer(cmdline, 3);
-                    if (!cmdline)
-                    {
-                        printf("No pattern given with -P argument");
-                        return 1;
-                    }
-                    // traverse these statement
-                    is_pattern = true;
-                    T.set_is_pattern(is_pattern);
-                    return T.traverse(str1, "", cmdline);
-                }
-                else
-                {
-                    printf("Invalid argument");
-                    return 1;
-                }
+                printf("Invalid level, must be greater than 0\n");
+                return 1;
             }
         }
+        else if (strcmp(arg, "-o") == 0)
+        {
+            output = next_argument(&cursor);
+            if (!output)
+            {
+                printf("No file given with -o argument\n");
+                return 1;
+            }
+        }
+        else if (strcmp(arg, "-j") == 0)
+        {
+            const char *threads_arg = next_argument(&cursor);
+            if (!threads_arg || !to_number(threads_arg, &threads))
+            {
+                printf("No thread count given with -j argument\n");
+                return 1;
+            }
+            if (threads > TREE_MAX_WORKERS)
+                threads = TREE_MAX_WORKERS;
+        }
+        else if (strcmp(arg, "--stats") == 0)
+            show_stats = true;
+        // only one directory can be given
+        else if (arg[0] == '-' || has_path)
+        {
+            printf("Invalid argument '%s'\n", arg);
+            return 1;
+        }
         else
-            path = cmdline;
+        {
+            path = arg;
+            has_path = true;
+        }
+    }
+
+    if (pattern)
+    {
+        if (!matcher.compile(pattern))
+            return 1;
+        opts.pattern = &matcher;
+    }
+    if (ignore)
+    {
+        if (!ignorer.compile(ignore))
+            return 1;
+        opts.ignore = &ignorer;
+    }
+    T.set_options(&opts);
+#ifdef TICKS_PER_SECOND
+    unsigned long start = get_ticks();
+#endif
+    if (!out.open_output(output))
+        return 1;
+    T.set_output(&out);
+    if (threads)
+    {
+        readers.start(threads, &opts);
+        T.set_pool(&readers);
+    }
+    int result = T.traverse(path);
+    if (threads)
+        readers.stop();
+    out.close_output();
+    if (show_stats)
+    {
+        printf("\nstatistics:\n");
+        printf("  opendir %lu, getdents %lu, readdir %lu, closedir %lu\n",
+               stats.opendir_calls, stats.getdents_calls, stats.readdir_calls, stats.closedir_calls);
+        printf("  pattern matches %lu, left out by -P %lu, by -I %lu\n", stats.matches, stats.unmatched, stats.ignored);
+        printf("  bytes written %lu\n", stats.bytes_written);
+        printf("  max depth %lu of %d\n", stats.max_depth, TREE_MAX_DEPTH);
+        printf("  peak path %lu of %d bytes, prefix %lu of %d bytes, output buffer %lu of %d bytes\n",
+               stats.peak_path, TREE_MAX_PATH, stats.peak_prefix, TREE_MAX_DEPTH * 4, stats.peak_output, TREE_OUTPUT_BUFFER);
+        if (threads)
+            printf("  peak pool slots %lu of %d\n", stats.peak_slots, TREE_MAX_SLOTS);
+#ifdef TICKS_PER_SECOND
+        unsigned long micros = (get_ticks() - start) / (TICKS_PER_SECOND / 1000000);
+        printf("  elapsed %lu.%03lu ms\n", micros / 1000, micros % 1000);
+#endif
     }
-    // usually normal tree <directory> or tree
-    T.set_is_pattern(is_pattern);
-    return T.traverse(path, "", pattern);
+    return result;
 }